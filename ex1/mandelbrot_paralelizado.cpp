@@ -3,6 +3,15 @@
 #include <iostream>
 #include <vector>
 #include <cmath>
+#include <cerrno>
+#include <deque>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "trace.h"
 
 #define MAXITER 32768
 
@@ -25,19 +34,21 @@ FILE* input; // descriptor for the list of tiles (cannot be stdin)
 unsigned int numThreads = 5; // decide how to choose the color palette //Número total de threads existentes (tabalhadoras + thread mestre)
 unsigned int tamMaxFilaFractais; //A fila de fractais terá tamanho de, no máximo, 4 vezes o número de threads trabalhadoras 
 unsigned int numThreadsTrabalhadoras;
+unsigned int limiarReabastecimento; //Uma trabalhadora pede para a thread mestre reabastecer quando a fila tem menos fractais que isso
 
 std::queue<fractal_param_t> filaFractais;
+std::queue<registro_trace_t> filaRegistrosTrace; //Anda junto com filaFractais: índice e instante de enfileiramento de cada fractal
 
 bool encontradoEOW = false; //Não sei se precisa
+bool acabouArquivoEntrada = false; //Depois disso a thread mestre não atende mais pedidos de reabastecimento
+bool pedidoReabastecimento = false; //Evita que o sinal para a thread mestre se perca se ela ainda não estiver esperando
 
 //----------------------------------------------
 //Mutex e variáveis de condição
 pthread_mutex_t mutexFilaDeFractais;
 
-pthread_mutex_t mutexFilaDeFractaisPreenchida;
 pthread_cond_t varCondFilaDeFractaisPreenchida;
 
-pthread_mutex_t mutexPreencherFilaDeFractais;
 pthread_cond_t varCondPreencherFilaDeFractais;
 
 //----------------------------------------------
@@ -51,6 +62,13 @@ float t_desvio;
 
 vector<int> tarefas_pt;
 
+//----------------------------------------------
+//Para a gravação do trace (opcional)
+bool gravandoTrace = false;
+struct timespec inicioExecucao;
+unsigned int indiceProximoTile = 0;
+vector<vector<registro_trace_t> > registrosTrace; //Um vetor por thread (0 = mestre), para não precisar de mutex ao registrar
+
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 //FUNÇÕES DISPONIBILIZADAS NO CÓDIGO BASE
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
@@ -87,7 +105,9 @@ int input_params(fractal_param_t* p){
  * a cada momento, para manter as restricoes desritas no enunciado.
  ****************************************************************/
 // Function to draw mandelbrot set
-void fractal(fractal_param_t* p){
+// Se iteracoes != NULL, guarda ali o numero de iteracoes de cada pixel
+// (ires x jres, linha a linha), usado pelo modo piramide.
+void fractal(fractal_param_t* p, unsigned short* iteracoes = NULL){
 	double dx, dy;
 	int i, j, k;
 	double x, y, u, v, u2, v2;
@@ -122,6 +142,9 @@ void fractal(fractal_param_t* p){
 				u2 = u * u;
 				v2 = v * v;
 			}
+			if ((iteracoes != NULL) && (i < p->ires)){
+				iteracoes[j * p->ires + i] = k;
+			}
 		}
 	}
 }
@@ -131,6 +154,73 @@ void fractal(fractal_param_t* p){
 //FUNÇÕES AUXILIARES
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
 
+//Instante atual em segundos desde o início da execução
+double instanteAtual(){
+    struct timespec agora;
+    clock_gettime(CLOCK_MONOTONIC, &agora);
+    return (agora.tv_sec - inicioExecucao.tv_sec) + (agora.tv_nsec - inicioExecucao.tv_nsec) / 1e9;
+}
+
+//Tempo de CPU já gasto pela thread que chama, em segundos
+double tempoCpuThread(){
+    struct timespec agora;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &agora);
+    return agora.tv_sec + agora.tv_nsec / 1e9;
+}
+
+void registrarTrace(long indexThread, uint16_t tipo, uint32_t indice, double enfileirado, double inicio, double fim, double custoCpu){
+    if (!gravandoTrace){
+        return;
+    }
+
+    registro_trace_t r;
+    r.tipo = tipo;
+    r.thread = indexThread;
+    r.indice = indice;
+    r.enfileirado = enfileirado;
+    r.inicio = inicio;
+    r.fim = fim;
+    r.custoCpu = custoCpu;
+    registrosTrace[indexThread].push_back(r);
+}
+
+void gravarTrace(const char* nomeArquivo){
+    cabecalho_trace_t cabecalho;
+    cabecalho.magico = TRACE_MAGICO;
+    cabecalho.versao = TRACE_VERSAO;
+    cabecalho.numThreadsTrabalhadoras = numThreadsTrabalhadoras;
+    cabecalho.tamMaxFilaFractais = tamMaxFilaFractais;
+    cabecalho.limiarReabastecimento = limiarReabastecimento;
+    cabecalho.reservado = 0;
+    cabecalho.numRegistros = 0;
+    for (size_t i = 0; i < registrosTrace.size(); ++i) {
+        cabecalho.numRegistros += registrosTrace[i].size();
+    }
+
+    FILE* saida = fopen(nomeArquivo, "wb");
+    if (saida == NULL){
+        perror("fopen(trace)");
+        exit(-1);
+    }
+    fwrite(&cabecalho, sizeof(cabecalho), 1, saida);
+    for (size_t i = 0; i < registrosTrace.size(); ++i) {
+        fwrite(registrosTrace[i].data(), sizeof(registro_trace_t), registrosTrace[i].size(), saida);
+    }
+    fclose(saida);
+
+    printf("Trace: %llu registros gravados em %s\n", (unsigned long long)cabecalho.numRegistros, nomeArquivo);
+}
+
+//Coloca um fractal na fila junto com o que o trace precisa saber dele
+void enfileirarFractal(const fractal_param_t& fractal, uint32_t indice){
+    registro_trace_t r;
+    r.indice = indice;
+    r.enfileirado = gravandoTrace ? instanteAtual() : 0.0;
+
+    filaFractais.push(fractal);
+    filaRegistrosTrace.push(r);
+}
+
 //Verifica se uma thread trabalhadora retirou da fila um fractal com todos os valores zerados, isto é, um registro de fim de tarefas (EOW)
 bool encontrouEOW(fractal_param_t* fractal){
     if(fractal->ires == 0 && fractal->jres == 0 && fractal->left == 0 && fractal->low == 0 && fractal->xmax == 0.0 && fractal->xmin == 0.0 && fractal->ymax == 0.0 && fractal->ymin == 0.0){
@@ -156,7 +246,7 @@ void registrarEOW(){
         fractal.ymax = 0.0;
         fractal.ymin = 0.0;
 
-        filaFractais.push(fractal);
+        enfileirarFractal(fractal, 0);
 
     }
 
@@ -175,7 +265,7 @@ bool preencherFilaFractais(){
     bool acabouArquivo = false;
 
     /*No momento de adição de fractais, a fila está sob uso exclusivo da thread mestre, isto é, todos os fractais 
-    necessários para preencher por completo a fila são adicionados fazendo uso do mutex mutexPreencherFilaDeFractais.
+    necessários para preencher por completo a fila são adicionados fazendo uso do mutex mutexFilaDeFractais.
     Ou seja, só depois que todos a fila for preenchida é dado um unlock no mutex para que as threads trabalhadoras
     possam continuar a consumir fractais.*/
     for (unsigned int i = 0; i<numFractaisAdicionar; i++){
@@ -183,7 +273,7 @@ bool preencherFilaFractais(){
             acabouArquivo = true;
             break;
         }
-        filaFractais.push(fractal);
+        enfileirarFractal(fractal, indiceProximoTile++);
     }
 
     if (acabouArquivo){
@@ -201,17 +291,32 @@ bool preencherFilaFractais(){
 void* rotinaThreadMestre(void* indexThread){
 
     bool acabouArquivo = false;
+    double inicio;
+    unsigned int tilesAntes;
 
     while(true){
 
-        pthread_mutex_lock(&mutexPreencherFilaDeFractais);
+        /*A fila inteira é protegida por mutexFilaDeFractais, inclusive durante a espera pelo pedido de reabastecimento,
+        para que o sinal de uma trabalhadora não se perca entre o teste e o pthread_cond_wait.*/
+        pthread_mutex_lock(&mutexFilaDeFractais);
+
+        while (!pedidoReabastecimento){
+            pthread_cond_wait(&varCondPreencherFilaDeFractais, &mutexFilaDeFractais);
+        }
+        pedidoReabastecimento = false;
 
-        while (pthread_cond_wait(&varCondPreencherFilaDeFractais, &mutexPreencherFilaDeFractais) != 0);
+        inicio = gravandoTrace ? instanteAtual() : 0.0;
+        tilesAntes = indiceProximoTile; //Conta só os tiles lidos, não os EOW
 
         acabouArquivo = preencherFilaFractais();
+        acabouArquivoEntrada = acabouArquivo;
+
+        if (gravandoTrace){
+            registrarTrace((long)indexThread, TRACE_REABASTECIMENTO, indiceProximoTile - tilesAntes, 0.0, inicio, instanteAtual(), 0.0);
+        }
 
-        pthread_mutex_unlock(&mutexPreencherFilaDeFractais);
         pthread_cond_broadcast(&varCondFilaDeFractaisPreenchida);
+        pthread_mutex_unlock(&mutexFilaDeFractais);
 
         if (acabouArquivo){
             break;
@@ -219,6 +324,7 @@ void* rotinaThreadMestre(void* indexThread){
         
     }
 
+    return NULL;
 }
 
 void* rotinaThreadTrabalhadora(void* indexThread){
@@ -226,6 +332,8 @@ void* rotinaThreadTrabalhadora(void* indexThread){
     long idThread = (long)indexThread - 1;
 
     fractal_param_t f;
+    registro_trace_t r;
+    double inicioEspera;
 
     while(true){
 
@@ -235,13 +343,26 @@ void* rotinaThreadTrabalhadora(void* indexThread){
             conta_fila_vazia ++;
         }
 
-        if ((filaFractais.size() < numThreadsTrabalhadoras) && !encontradoEOW){ //Com o <= deu ruim
+        if ((filaFractais.size() < limiarReabastecimento) && !encontradoEOW && !acabouArquivoEntrada){ //Com o <= deu ruim
+            pedidoReabastecimento = true;
             pthread_cond_signal(&varCondPreencherFilaDeFractais); //Acordar a thread mestre 
-            while (pthread_cond_wait(&varCondFilaDeFractaisPreenchida, &mutexFilaDeFractaisPreenchida) != 0);
+        }
+
+        //Só precisa esperar a thread mestre se não sobrou nada na fila
+        if (filaFractais.empty()){
+            inicioEspera = gravandoTrace ? instanteAtual() : 0.0;
+            while (filaFractais.empty()){
+                pthread_cond_wait(&varCondFilaDeFractaisPreenchida, &mutexFilaDeFractais);
+            }
+            if (gravandoTrace){
+                registrarTrace((long)indexThread, TRACE_ESPERA, 0, 0.0, inicioEspera, instanteAtual(), 0.0);
+            }
         }
 
         f = filaFractais.front();
         filaFractais.pop();
+        r = filaRegistrosTrace.front();
+        filaRegistrosTrace.pop();
 
         if (encontrouEOW(&f)){
             encontradoEOW = true;
@@ -251,13 +372,379 @@ void* rotinaThreadTrabalhadora(void* indexThread){
 
         pthread_mutex_unlock(&mutexFilaDeFractais);
 
+        r.inicio = gravandoTrace ? instanteAtual() : 0.0;
+        r.custoCpu = gravandoTrace ? tempoCpuThread() : 0.0;
+
         fractal(&f);
 
+        if (gravandoTrace){
+            registrarTrace((long)indexThread, TRACE_TILE, r.indice, r.enfileirado, r.inicio, instanteAtual(), tempoCpuThread() - r.custoCpu);
+        }
+
         total_tarefas ++;
         tarefas_pt[idThread]++;
 
     }
 
+    return NULL;
+}
+
+
+//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+//MODO PIRÂMIDE (TILES z/x/y SOB DEMANDA)
+//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+/*A região raiz (primeira linha de um arquivo como mandelbrot_tasks/h) é o tile 0/0/0. No nível z o domínio
+é dividido em 2^z x 2^z tiles, cada um com a mesma resolução em pixels da raiz. Os pedidos "z x y" chegam pela
+entrada padrão; cada tile é calculado uma única vez (com a mesma fractal()) e guardado em disco no diretório de cache.
+Depois de atender um pedido, os vizinhos do tile (mesmo nível, pai e filhos) são colocados numa fila de pré-busca,
+que as threads trabalhadoras só consomem quando não há nenhum pedido de fato esperando.*/
+
+#define LIMITE_NIVEL_PIRAMIDE 62 //Para 1L << z não estourar
+
+typedef struct {
+    int z; long x; long y;
+} tile_piramide_t;
+
+fractal_param_t raizPiramide;
+int nivelMaxPiramide; //Calculado a partir da raiz por calcularNivelMaxPiramide
+string dirCachePiramide;
+
+std::deque<tile_piramide_t> filaPedidosPiramide;  //Tiles pedidos pelo visualizador (prioridade alta)
+std::deque<tile_piramide_t> filaPreBuscaPiramide; //Vizinhos a serem pré-calculados (prioridade baixa)
+std::set<string> tilesEmAndamento;                 //Tiles enfileirados ou sendo calculados, para não repetir trabalho
+
+bool fimPiramide = false;
+
+pthread_mutex_t mutexPiramide;
+pthread_cond_t varCondTrabalhoPiramide;
+pthread_cond_t varCondTileConcluido;
+
+//Para a coleta das estatísticas
+int acertos_cache = 0;
+int faltas_cache = 0;
+int tiles_pre_buscados = 0;
+
+string chaveTile(const tile_piramide_t& t){
+    return to_string(t.z) + "_" + to_string(t.x) + "_" + to_string(t.y);
+}
+
+string caminhoTile(const tile_piramide_t& t){
+    return dirCachePiramide + "/" + chaveTile(t) + ".tile";
+}
+
+bool tileValido(const tile_piramide_t& t){
+    if (t.z < 0 || t.z > nivelMaxPiramide){
+        return false;
+    }
+    long lado = 1L << t.z;
+    return (t.x >= 0 && t.x < lado && t.y >= 0 && t.y < lado);
+}
+
+/*Maior nível em que os tiles ainda fazem sentido: a distância entre dois pixels vizinhos tem que ser maior que o ulp
+das coordenadas da raiz, senão os pixels colapsam no mesmo double e o tile sai degenerado.
+Para a raiz de mandelbrot_tasks/h (largura 1e-6 perto de x = 0.27, 640 pixels) isso dá z = 24.*/
+int calcularNivelMaxPiramide(){
+    double maiorX = max(fabs(raizPiramide.xmin), fabs(raizPiramide.xmax));
+    double maiorY = max(fabs(raizPiramide.ymin), fabs(raizPiramide.ymax));
+    double ulpX = nextafter(maiorX, INFINITY) - maiorX;
+    double ulpY = nextafter(maiorY, INFINITY) - maiorY;
+
+    int z = 0;
+    while (z < LIMITE_NIVEL_PIRAMIDE){
+        double lado = ldexp(1.0, z + 1);
+        double passoX = (raizPiramide.xmax - raizPiramide.xmin) / lado / raizPiramide.ires;
+        double passoY = (raizPiramide.ymax - raizPiramide.ymin) / lado / raizPiramide.jres;
+
+        if (passoX <= ulpX || passoY <= ulpY){
+            break;
+        }
+        z++;
+    }
+
+    return z;
+}
+
+bool tileEmCache(const tile_piramide_t& t){
+    return access(caminhoTile(t).c_str(), F_OK) == 0;
+}
+
+/*Os tiles só valem para a raiz e o MAXITER com que foram calculados. Na primeira vez que o diretório de cache é usado,
+esses valores são gravados em <cachedir>/raiz; nas execuções seguintes, se forem diferentes, o programa se recusa a usar o cache.*/
+void verificarRaizCache(){
+    char descricao[512];
+    snprintf(descricao, sizeof(descricao), "MAXITER %d\n%d %d %d %d\n%.17g %.17g %.17g %.17g\n", MAXITER,
+        raizPiramide.left, raizPiramide.low, raizPiramide.ires, raizPiramide.jres,
+        raizPiramide.xmin, raizPiramide.ymin, raizPiramide.xmax, raizPiramide.ymax);
+
+    string caminho = dirCachePiramide + "/raiz";
+    FILE* arquivo = fopen(caminho.c_str(), "r");
+
+    if (arquivo != NULL){
+        char gravada[512];
+        size_t n = fread(gravada, 1, sizeof(gravada) - 1, arquivo);
+        gravada[n] = '\0';
+        fclose(arquivo);
+
+        if (string(gravada) != descricao){
+            fprintf(stderr,"%s: cache calculado para outra raiz ou outro MAXITER; use outro diretorio\n", dirCachePiramide.c_str());
+            exit(-1);
+        }
+        return;
+    }
+
+    arquivo = fopen(caminho.c_str(), "w");
+    if (arquivo == NULL || fputs(descricao, arquivo) == EOF || fclose(arquivo) != 0){
+        perror("raiz do cache");
+        exit(-1);
+    }
+}
+
+//Converte o tile z/x/y para os parâmetros do fractal, subdividindo o domínio da raiz. O y cresce no mesmo sentido de low/ymin.
+void tileParaFractal(const tile_piramide_t& t, fractal_param_t* p){
+    double lado = (double)(1L << t.z);
+    double larguraTile = (raizPiramide.xmax - raizPiramide.xmin) / lado;
+    double alturaTile = (raizPiramide.ymax - raizPiramide.ymin) / lado;
+
+    p->ires = raizPiramide.ires;
+    p->jres = raizPiramide.jres;
+    p->left = 0; //A posição na tela não é usada no modo pirâmide e não caberia em int nos níveis mais fundos
+    p->low = 0;
+    p->xmin = raizPiramide.xmin + t.x * larguraTile;
+    p->ymin = raizPiramide.ymin + t.y * alturaTile;
+    p->xmax = p->xmin + larguraTile;
+    p->ymax = p->ymin + alturaTile;
+}
+
+/*Grava o tile em um arquivo temporário e depois o renomeia, para que um leitor nunca veja um tile pela metade.
+Formato: ires e jres (int) seguidos de ires*jres contagens de iterações (unsigned short), linha a linha.*/
+void gravarTile(const tile_piramide_t& t, const fractal_param_t* p, const vector<unsigned short>& iteracoes){
+    string caminho = caminhoTile(t);
+    string temporario = caminho + ".tmp";
+
+    FILE* saida = fopen(temporario.c_str(), "wb");
+    if (saida == NULL){
+        perror("fopen(tile)");
+        exit(-1);
+    }
+    //Uma escrita incompleta (disco cheio, p.ex.) não pode virar um acerto permanente no cache
+    bool gravou = (fwrite(&(p->ires), sizeof(int), 1, saida) == 1);
+    gravou = gravou && (fwrite(&(p->jres), sizeof(int), 1, saida) == 1);
+    gravou = gravou && (fwrite(iteracoes.data(), sizeof(unsigned short), iteracoes.size(), saida) == iteracoes.size());
+    gravou = (fclose(saida) == 0) && gravou;
+
+    if (!gravou){
+        perror("fwrite(tile)");
+        unlink(temporario.c_str());
+        exit(-1);
+    }
+
+    if (rename(temporario.c_str(), caminho.c_str()) != 0){
+        perror("rename(tile)");
+        exit(-1);
+    }
+}
+
+//Deve ser chamada com mutexPiramide travado. A fila de pré-busca é limitada por tamMaxFilaFractais: os vizinhos mais antigos são descartados, já que o visualizador provavelmente se afastou deles.
+void agendarPreBusca(const tile_piramide_t& t){
+    if (!tileValido(t) || tilesEmAndamento.count(chaveTile(t)) || tileEmCache(t)){
+        return;
+    }
+
+    if (filaPreBuscaPiramide.size() >= tamMaxFilaFractais){
+        tilesEmAndamento.erase(chaveTile(filaPreBuscaPiramide.front()));
+        filaPreBuscaPiramide.pop_front();
+    }
+
+    tilesEmAndamento.insert(chaveTile(t));
+    filaPreBuscaPiramide.push_back(t);
+    pthread_cond_signal(&varCondTrabalhoPiramide);
+}
+
+void agendarVizinhos(const tile_piramide_t& t){
+    for (long dy = -1; dy <= 1; dy++){
+        for (long dx = -1; dx <= 1; dx++){
+            if (dx != 0 || dy != 0){
+                agendarPreBusca({t.z, t.x + dx, t.y + dy});
+            }
+        }
+    }
+
+    agendarPreBusca({t.z - 1, t.x / 2, t.y / 2}); //Afastar o zoom
+
+    for (long i = 0; i < 4; i++){ //Aproximar o zoom
+        agendarPreBusca({t.z + 1, 2*t.x + (i & 1), 2*t.y + (i >> 1)});
+    }
+}
+
+//Atende um pedido do visualizador: devolve na hora se o tile já está em disco, senão o coloca na frente do trabalho e espera.
+void solicitarTile(const tile_piramide_t& t){
+    string chave = chaveTile(t);
+    bool acerto = true;
+
+    pthread_mutex_lock(&mutexPiramide);
+
+    if (!tileEmCache(t)){
+        acerto = false;
+
+        if (tilesEmAndamento.count(chave)){
+            //Se ainda está só na fila de pré-busca, promove para a fila de pedidos
+            for (std::deque<tile_piramide_t>::iterator it = filaPreBuscaPiramide.begin(); it != filaPreBuscaPiramide.end(); ++it){
+                if (chaveTile(*it) == chave){
+                    filaPreBuscaPiramide.erase(it);
+                    filaPedidosPiramide.push_back(t);
+                    break;
+                }
+            }
+        }
+        else{
+            tilesEmAndamento.insert(chave);
+            filaPedidosPiramide.push_back(t);
+        }
+        pthread_cond_signal(&varCondTrabalhoPiramide);
+
+        while (tilesEmAndamento.count(chave)){
+            pthread_cond_wait(&varCondTileConcluido, &mutexPiramide);
+        }
+    }
+
+    if (acerto){
+        acertos_cache++;
+    }
+    else{
+        faltas_cache++;
+    }
+
+    agendarVizinhos(t);
+
+    pthread_mutex_unlock(&mutexPiramide);
+
+    printf("%d %ld %ld %s %s\n", t.z, t.x, t.y, acerto ? "hit" : "miss", caminhoTile(t).c_str());
+    fflush(stdout);
+}
+
+void* rotinaThreadTrabalhadoraPiramide(void* indexThread){
+
+    fractal_param_t f;
+    tile_piramide_t t;
+    bool preBusca;
+    vector<unsigned short> iteracoes;
+
+    while(true){
+
+        pthread_mutex_lock(&mutexPiramide);
+
+        while (filaPedidosPiramide.empty() && filaPreBuscaPiramide.empty() && !fimPiramide){
+            pthread_cond_wait(&varCondTrabalhoPiramide, &mutexPiramide);
+        }
+
+        if (filaPedidosPiramide.empty() && filaPreBuscaPiramide.empty()){ //fimPiramide
+            pthread_mutex_unlock(&mutexPiramide);
+            break;
+        }
+
+        preBusca = filaPedidosPiramide.empty();
+        if (preBusca){
+            t = filaPreBuscaPiramide.front();
+            filaPreBuscaPiramide.pop_front();
+        }
+        else{
+            t = filaPedidosPiramide.front();
+            filaPedidosPiramide.pop_front();
+        }
+
+        pthread_mutex_unlock(&mutexPiramide);
+
+        tileParaFractal(t, &f);
+        iteracoes.assign((size_t)f.ires * f.jres, 0);
+        fractal(&f, iteracoes.data());
+        gravarTile(t, &f, iteracoes);
+
+        pthread_mutex_lock(&mutexPiramide);
+        tilesEmAndamento.erase(chaveTile(t));
+        if (preBusca){
+            tiles_pre_buscados++;
+        }
+        pthread_cond_broadcast(&varCondTileConcluido);
+        pthread_mutex_unlock(&mutexPiramide);
+
+    }
+
+    return NULL;
+}
+
+int executarModoPiramide(int argc, char* argv[]){
+
+    if ((argc!=4)&&(argc!=5)){
+        fprintf(stderr,"usage %s -p rootfile cachedir [numThreads]\n", argv[0]);
+        exit(-1);
+    }
+
+    if (argc==5) {
+        numThreads = std::stoi(argv[4]) + 1;
+    }
+    numThreadsTrabalhadoras = numThreads - 1;
+    tamMaxFilaFractais = 4*numThreadsTrabalhadoras;
+    pthread_t threads[numThreadsTrabalhadoras];
+
+    if ((input=fopen(argv[2],"r"))==NULL){
+        perror("fdopen");
+        exit(-1);
+    }
+    if (input_params(&raizPiramide) == EOF){
+        fprintf(stderr,"%s: arquivo sem regiao raiz\n", argv[2]);
+        exit(-1);
+    }
+    if (raizPiramide.ires <= 0 || raizPiramide.jres <= 0 || raizPiramide.xmax <= raizPiramide.xmin || raizPiramide.ymax <= raizPiramide.ymin){
+        fprintf(stderr,"%s: regiao raiz invalida\n", argv[2]);
+        exit(-1);
+    }
+    nivelMaxPiramide = calcularNivelMaxPiramide();
+    fclose(input);
+
+    dirCachePiramide = argv[3];
+    if (mkdir(dirCachePiramide.c_str(), 0755) != 0 && errno != EEXIST){
+        perror("mkdir");
+        exit(-1);
+    }
+    verificarRaizCache();
+
+    pthread_mutex_init(&mutexPiramide, NULL);
+    pthread_cond_init(&varCondTrabalhoPiramide, NULL);
+    pthread_cond_init(&varCondTileConcluido, NULL);
+
+    for(long indexThread = 0; indexThread<numThreadsTrabalhadoras; indexThread++){
+        pthread_create(&threads[indexThread], NULL, rotinaThreadTrabalhadoraPiramide, (void*) indexThread);
+    }
+
+    //Cada linha da entrada padrão é um pedido "z x y"
+    tile_piramide_t t;
+    while (scanf("%d %ld %ld", &t.z, &t.x, &t.y) == 3){
+        if (!tileValido(t)){
+            fprintf(stderr,"tile invalido: %d %ld %ld (nivel maximo para esta raiz: %d)\n", t.z, t.x, t.y, nivelMaxPiramide);
+            continue;
+        }
+        solicitarTile(t);
+    }
+
+    //Os vizinhos já enfileirados são terminados antes de sair, para ficarem no cache da próxima execução
+    pthread_mutex_lock(&mutexPiramide);
+    fimPiramide = true;
+    pthread_cond_broadcast(&varCondTrabalhoPiramide);
+    pthread_mutex_unlock(&mutexPiramide);
+
+    for(long indexThread = 0; indexThread<numThreadsTrabalhadoras; indexThread++){
+        pthread_join(threads[indexThread], NULL);
+    }
+
+    pthread_mutex_destroy(&mutexPiramide);
+    pthread_cond_destroy(&varCondTrabalhoPiramide);
+    pthread_cond_destroy(&varCondTileConcluido);
+
+    //A saída padrão é só das respostas ao visualizador
+    fprintf(stderr,"Tiles: pedidos = %d; acertos no cache = %d; faltas = %d; pre-buscados = %d\n",
+        acertos_cache + faltas_cache, acertos_cache, faltas_cache, tiles_pre_buscados);
+
+    return 0;
 }
 
 
@@ -266,18 +753,30 @@ void* rotinaThreadTrabalhadora(void* indexThread){
 //%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%*
 int main (int argc, char* argv[]){
 
-    if ((argc!=2)&&(argc!=3)){
-        fprintf(stderr,"usage %s filename [numThreads]\n", argv[0]);
+    if ((argc>1) && (string(argv[1]) == "-p")){
+        return executarModoPiramide(argc, argv);
+    }
+
+    if ((argc<2)||(argc>4)){
+        fprintf(stderr,"usage %s filename [numThreads [tracefile]]\n       %s -p rootfile cachedir [numThreads]\n", argv[0], argv[0]);
         exit(-1);
     } 
 
     //Caso o parâmetro adicional "número de threads trabalhadoras" for passado
-    if (argc==3) {
+    if (argc>=3) {
         numThreads = std::stoi(argv[2]) + 1; //número de threads trabalhadoras + 1 thread mestre
     }
+
+    //Caso seja passado um arquivo de trace, cada tile, espera e reabastecimento é registrado (ver trace.h e simulador.cpp)
+    if (argc==4) {
+        gravandoTrace = true;
+        registrosTrace.resize(numThreads);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &inicioExecucao);
     pthread_t threads[numThreads];
     numThreadsTrabalhadoras = numThreads - 1;
     tamMaxFilaFractais = 4*numThreadsTrabalhadoras;
+    limiarReabastecimento = numThreadsTrabalhadoras;
 
     if ((input=fopen(argv[1],"r"))==NULL){
         perror("fdopen");
@@ -285,8 +784,6 @@ int main (int argc, char* argv[]){
     }
 
     pthread_mutex_init(&mutexFilaDeFractais, NULL);
-    pthread_mutex_init(&mutexPreencherFilaDeFractais, NULL);
-    pthread_mutex_init(&mutexFilaDeFractaisPreenchida, NULL);
 
     pthread_cond_init(&varCondPreencherFilaDeFractais, NULL);
     pthread_cond_init(&varCondFilaDeFractaisPreenchida, NULL);
@@ -308,8 +805,6 @@ int main (int argc, char* argv[]){
 
         //Destruir todas? Onde?
     pthread_mutex_destroy(&mutexFilaDeFractais);
-    pthread_mutex_destroy(&mutexPreencherFilaDeFractais);
-    pthread_mutex_destroy(&mutexFilaDeFractaisPreenchida);
 
     pthread_cond_destroy(&varCondPreencherFilaDeFractais);
     pthread_cond_destroy(&varCondFilaDeFractaisPreenchida);
@@ -330,6 +825,10 @@ int main (int argc, char* argv[]){
     //printf("Tempo médio por tarefa: %.6f (%.6f) ms\n", t_medio, t_desvio);
     printf("Fila estava vazia: %d vezes\n", conta_fila_vazia);
 
+    if (gravandoTrace){
+        gravarTrace(argv[3]);
+    }
+
 	return 0;
 
 }
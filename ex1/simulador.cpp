@@ -0,0 +1,482 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "trace.h"
+
+using namespace std;
+
+/****************************************************************
+ * Simulador offline do escalonador. Le um trace gravado pelo
+ * prog (./prog arquivo numThreads arquivoTrace) e repete os
+ * custos dos tiles sob outras politicas, outros numeros de
+ * threads e outros parametros do protocolo mestre/trabalhadoras
+ * (tamanho da fila e limiar de reabastecimento), prevendo o
+ * makespan e o tempo ocioso sem precisar calcular nenhum fractal.
+ ****************************************************************/
+
+//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+//DECLARAÇÕES GLOBAIS
+//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+cabecalho_trace_t cabecalho;
+vector<registro_trace_t> registros;
+
+/*Custo de cada tile, na ordem do arquivo de entrada. É o tempo de CPU da trabalhadora, não o de relógio: com mais
+threads que núcleos o tempo de relógio inclui o tempo fora do processador e não vale para outro número de threads.*/
+vector<double> custos;
+
+/*Custo de cada retirada da fila compartilhada (lock, pop e eventuais esperas pela thread mestre), estimado a partir
+do trace como a mediana dos intervalos entre o fim de um tile e a retirada do próximo pela mesma trabalhadora.
+A fila só atende uma retirada por vez, então esse custo também modela a contenção com muitas threads.*/
+double sobrecargaRetirada = 0.0;
+
+/*Custo de uma chamada a preencherFilaFractais que lê k tiles: custoFixoReabastecimento + k * custoPorTileReabastecimento,
+ajustado por mínimos quadrados sobre os registros REABASTECIMENTO. Durante o reabastecimento a thread mestre segura
+mutexFilaDeFractais, então nenhuma trabalhadora consegue retirar nada da fila.*/
+double custoFixoReabastecimento = 0.0;
+double custoPorTileReabastecimento = 0.0;
+
+//Tamanho da fila ou limiar de reabastecimento: um valor absoluto ou um múltiplo do número de trabalhadoras ("4n")
+typedef struct {
+    int valor;
+    bool porThread;
+} parametro_protocolo_t;
+
+typedef struct {
+    double makespan;
+    double ociosidade; //Soma, em todas as trabalhadoras, do tempo em que não estavam calculando tiles
+} resultado_simulacao_t;
+
+resultado_simulacao_t execucaoGravada;
+
+//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+//LEITURA DO TRACE
+//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+void lerTrace(const char* nomeArquivo, cabecalho_trace_t& cabecalho, vector<registro_trace_t>& registros){
+    FILE* entrada = fopen(nomeArquivo, "rb");
+    if (entrada == NULL){
+        perror("fopen(trace)");
+        exit(-1);
+    }
+
+    if (fread(&cabecalho, sizeof(cabecalho), 1, entrada) != 1 || cabecalho.magico != TRACE_MAGICO){
+        fprintf(stderr, "%s: nao e um trace do prog\n", nomeArquivo);
+        exit(-1);
+    }
+    if (cabecalho.versao != TRACE_VERSAO){
+        fprintf(stderr, "%s: versao %u do trace nao suportada\n", nomeArquivo, cabecalho.versao);
+        exit(-1);
+    }
+
+    registros.resize(cabecalho.numRegistros);
+    if (fread(registros.data(), sizeof(registro_trace_t), registros.size(), entrada) != registros.size()){
+        fprintf(stderr, "%s: trace truncado\n", nomeArquivo);
+        exit(-1);
+    }
+    fclose(entrada);
+}
+
+/*O que de fato aconteceu numa execução gravada, medido como na simulação: do primeiro reabastecimento (a primeira
+trabalhadora pedindo trabalho) até o fim do último tile; a ociosidade é o tempo das trabalhadoras fora de fractal().*/
+resultado_simulacao_t medirExecucao(const cabecalho_trace_t& cabecalho, const vector<registro_trace_t>& registros, size_t* numTiles){
+    double inicio = -1.0, fim = 0.0, soma = 0.0;
+    *numTiles = 0;
+
+    for (size_t i = 0; i < registros.size(); ++i) {
+        double comeco = -1.0;
+        if (registros[i].tipo == TRACE_TILE){
+            comeco = registros[i].enfileirado;
+            fim = max(fim, registros[i].fim);
+            soma += registros[i].custoCpu;
+            (*numTiles)++;
+        }
+        else if (registros[i].tipo == TRACE_REABASTECIMENTO){
+            comeco = registros[i].inicio;
+        }
+        if (comeco >= 0 && (inicio < 0 || comeco < inicio)){
+            inicio = comeco;
+        }
+    }
+
+    resultado_simulacao_t r;
+    r.makespan = fim - max(inicio, 0.0);
+    r.ociosidade = cabecalho.numThreadsTrabalhadoras * r.makespan - soma;
+    return r;
+}
+
+double mediana(vector<double> v){
+    if (v.empty()){
+        return 0.0;
+    }
+    sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+//Extrai os custos dos tiles e a sobrecarga por retirada, e imprime o que de fato aconteceu na execução gravada
+void analisarTrace(){
+    vector<registro_trace_t> tiles;
+    double espera = 0.0, reabastecimento = 0.0;
+    int numEsperas = 0, numReabastecimentos = 0;
+    double sk = 0.0, sd = 0.0, skk = 0.0, skd = 0.0; //Somas para o ajuste do custo de reabastecimento
+
+    for (size_t i = 0; i < registros.size(); ++i) {
+        if (registros[i].tipo == TRACE_TILE){
+            tiles.push_back(registros[i]);
+        }
+        else if (registros[i].tipo == TRACE_ESPERA){
+            espera += registros[i].fim - registros[i].inicio;
+            numEsperas++;
+        }
+        else if (registros[i].tipo == TRACE_REABASTECIMENTO){
+            double k = registros[i].indice, d = registros[i].fim - registros[i].inicio;
+            reabastecimento += d;
+            numReabastecimentos++;
+            sk += k; sd += d; skk += k*k; skd += k*d;
+        }
+    }
+
+    if (tiles.empty()){
+        fprintf(stderr, "trace sem tiles\n");
+        exit(-1);
+    }
+
+    custos.assign(tiles.size(), 0.0);
+    double soma = 0.0;
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        if (tiles[i].indice >= custos.size()){
+            fprintf(stderr, "trace com indice de tile invalido: %u\n", tiles[i].indice);
+            exit(-1);
+        }
+        custos[tiles[i].indice] = tiles[i].custoCpu;
+        soma += custos[tiles[i].indice];
+    }
+
+    //Os registros de cada trabalhadora já estão em ordem de retirada
+    vector<double> intervalos;
+    for (size_t i = 1; i < tiles.size(); ++i) {
+        if (tiles[i].thread == tiles[i-1].thread){
+            intervalos.push_back(tiles[i].inicio - tiles[i-1].fim);
+        }
+    }
+    sobrecargaRetirada = mediana(intervalos);
+
+    if (numReabastecimentos > 0){
+        double denominador = numReabastecimentos * skk - sk * sk;
+        if (denominador > 0){
+            custoPorTileReabastecimento = max(0.0, (numReabastecimentos * skd - sk * sd) / denominador);
+            custoFixoReabastecimento = max(0.0, (sd - custoPorTileReabastecimento * sk) / numReabastecimentos);
+        }
+        else{ //Todos os reabastecimentos leram o mesmo número de tiles
+            custoFixoReabastecimento = sd / numReabastecimentos;
+        }
+    }
+
+    size_t numTiles;
+    execucaoGravada = medirExecucao(cabecalho, registros, &numTiles);
+
+    printf("Trace: %zu tiles; %u trabalhadoras; fila de ate %u fractais; reabastece com menos de %u\n", custos.size(),
+        cabecalho.numThreadsTrabalhadoras, cabecalho.tamMaxFilaFractais, cabecalho.limiarReabastecimento);
+    printf("Custo dos tiles: total = %.6f s; maior = %.6f s; sobrecarga por retirada = %.9f s\n",
+        soma, *max_element(custos.begin(), custos.end()), sobrecargaRetirada);
+    printf("Custo do reabastecimento: %.9f s + %.9f s por tile\n", custoFixoReabastecimento, custoPorTileReabastecimento);
+    printf("Execucao real: makespan = %.6f s; ociosidade = %.6f s; esperas pela mestre = %d (%.6f s); reabastecimentos = %d (%.6f s)\n",
+        execucaoGravada.makespan, execucaoGravada.ociosidade, numEsperas, espera, numReabastecimentos, reabastecimento);
+}
+
+//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+//POLÍTICAS DE ESCALONAMENTO SIMULADAS
+//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+
+//Heap de (instante em que fica livre, trabalhadora): a próxima a agir é sempre a que fica livre primeiro
+typedef priority_queue<pair<double, int>, vector<pair<double, int> >, greater<pair<double, int> > > heap_trabalhadoras_t;
+
+resultado_simulacao_t resultado(double makespan, unsigned int numTrabalhadoras, const vector<double>& ordem){
+    resultado_simulacao_t r;
+    double soma = 0.0;
+    for (size_t i = 0; i < ordem.size(); ++i) {
+        soma += ordem[i];
+    }
+    r.makespan = makespan;
+    r.ociosidade = numTrabalhadoras * makespan - soma;
+    return r;
+}
+
+double custoReabastecimento(size_t tilesLidos){
+    return custoFixoReabastecimento + tilesLidos * custoPorTileReabastecimento;
+}
+
+/*Protocolo do prog, com a thread mestre como um ator à parte. Cada trabalhadora, ao pegar mutexFilaDeFractais:
+pede um reabastecimento se a fila tem menos de limiar fractais e o arquivo não acabou; se a fila está vazia, espera a
+mestre; senão retira até tamLote tiles consecutivos de ordem, pagando uma sobrecargaRetirada. A mestre completa a fila
+até tamFila segurando o mutex durante custoReabastecimento, e só percebe o fim do arquivo quando tenta ler além dele
+(como preencherFilaFractais). Com a fila vazia e o arquivo no fim, a trabalhadora retira um EOW e termina.
+Com tamLote = 1 é o FIFO do prog; com ordem decrescente de custo é o LPT.*/
+resultado_simulacao_t simularProtocolo(const vector<double>& ordem, unsigned int numTrabalhadoras, unsigned int tamLote,
+                                       unsigned int tamFila, unsigned int limiar){
+    heap_trabalhadoras_t livres;
+    for (unsigned int i = 0; i < numTrabalhadoras; i++){
+        livres.push(make_pair(0.0, (int)i));
+    }
+
+    double filaLivre = 0.0, makespan = 0.0;
+    size_t lidos = 0;   //Tiles que a mestre já colocou na fila
+    size_t proximo = 0; //Próximo tile a ser retirado
+    bool acabouArquivo = false;
+
+    while (!livres.empty()){
+        pair<double, int> t = livres.top();
+        livres.pop();
+
+        double agora = max(t.first, filaLivre);
+        bool pediu = ((lidos - proximo) < limiar) && !acabouArquivo;
+
+        //Um reabastecimento feito aqui (fila vazia) ou depois da retirada (fila abaixo do limiar)
+        size_t aLer = min((size_t)tamFila - (lidos - proximo), ordem.size() - lidos);
+
+        if ((lidos == proximo) && pediu){
+            acabouArquivo = (ordem.size() - lidos) < (size_t)tamFila;
+            lidos += aLer;
+            agora += custoReabastecimento(aLer);
+            pediu = false;
+        }
+
+        if (lidos == proximo){ //Só sobrou o EOW
+            filaLivre = agora + sobrecargaRetirada;
+            continue;
+        }
+
+        double retirada = agora + sobrecargaRetirada;
+        filaLivre = retirada;
+
+        double fim = retirada;
+        for (unsigned int k = 0; k < tamLote && proximo < lidos; k++){
+            fim += ordem[proximo++];
+        }
+
+        if (pediu){
+            aLer = min((size_t)tamFila - (lidos - proximo), ordem.size() - lidos);
+            acabouArquivo = (ordem.size() - lidos) < (size_t)tamFila - (lidos - proximo);
+            lidos += aLer;
+            filaLivre = retirada + custoReabastecimento(aLer);
+        }
+
+        makespan = max(makespan, fim);
+        livres.push(make_pair(fim, t.second));
+    }
+
+    return resultado(makespan, numTrabalhadoras, ordem);
+}
+
+/*Roubo de trabalho: os tiles são divididos em blocos contíguos, um deque por trabalhadora, o que exige ler o arquivo
+inteiro antes de começar. Retirar do próprio deque não tem sobrecarga; quem esvazia o seu rouba metade do fim do deque
+mais cheio, pagando uma sobrecargaRetirada.*/
+resultado_simulacao_t simularRouboDeTrabalho(const vector<double>& ordem, unsigned int numTrabalhadoras){
+    vector<deque<double> > deques(numTrabalhadoras);
+    for (size_t i = 0; i < ordem.size(); ++i) {
+        deques[i * numTrabalhadoras / ordem.size()].push_back(ordem[i]);
+    }
+
+    double leitura = custoReabastecimento(ordem.size());
+
+    heap_trabalhadoras_t livres;
+    for (unsigned int i = 0; i < numTrabalhadoras; i++){
+        livres.push(make_pair(leitura, (int)i));
+    }
+
+    double makespan = 0.0;
+
+    while (!livres.empty()){
+        pair<double, int> t = livres.top();
+        livres.pop();
+        double agora = t.first;
+        deque<double>& meu = deques[t.second];
+
+        if (meu.empty()){
+            int vitima = -1;
+            for (unsigned int v = 0; v < numTrabalhadoras; v++){
+                if (!deques[v].empty() && (vitima < 0 || deques[v].size() > deques[vitima].size())){
+                    vitima = v;
+                }
+            }
+            if (vitima < 0){ //Nada mais a fazer: essa trabalhadora termina
+                makespan = max(makespan, agora);
+                continue;
+            }
+
+            size_t quantos = (deques[vitima].size() + 1) / 2;
+            for (size_t k = 0; k < quantos; k++){
+                meu.push_front(deques[vitima].back());
+                deques[vitima].pop_back();
+            }
+            agora += sobrecargaRetirada;
+        }
+
+        agora += meu.front();
+        meu.pop_front();
+        livres.push(make_pair(agora, t.second));
+    }
+
+    return resultado(makespan, numTrabalhadoras, ordem);
+}
+
+//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+//FUNÇÃO MAIN
+//%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+int lerInteiroPositivo(const string& texto, const char* nome){
+    int valor = std::stoi(texto);
+    if (valor < 1){
+        fprintf(stderr,"%s deve ser positivo: %s\n", nome, texto.c_str());
+        exit(-1);
+    }
+    return valor;
+}
+
+parametro_protocolo_t lerParametroProtocolo(string texto, const char* nome){
+    parametro_protocolo_t p;
+    p.porThread = !texto.empty() && texto[texto.size() - 1] == 'n';
+    if (p.porThread){
+        texto.erase(texto.size() - 1);
+    }
+    p.valor = lerInteiroPositivo(texto, nome);
+    return p;
+}
+
+//O padrão é o que foi gravado, como múltiplo do número de trabalhadoras quando possível (o prog usa 4n e n)
+parametro_protocolo_t parametroGravado(unsigned int valor){
+    parametro_protocolo_t p;
+    p.porThread = (valor % cabecalho.numThreadsTrabalhadoras == 0);
+    p.valor = p.porThread ? valor / cabecalho.numThreadsTrabalhadoras : valor;
+    return p;
+}
+
+unsigned int resolverParametro(parametro_protocolo_t p, unsigned int numTrabalhadoras){
+    return p.porThread ? p.valor * numTrabalhadoras : p.valor;
+}
+
+string descreverParametro(parametro_protocolo_t p){
+    return to_string(p.valor) + (p.porThread ? "n" : "");
+}
+
+void imprimirResultado(const char* politica, unsigned int numTrabalhadoras, resultado_simulacao_t r){
+    printf("%-8s %8u %14.6f %14.6f %9.2f%%\n", politica, numTrabalhadoras, r.makespan, r.ociosidade,
+        100.0 * r.ociosidade / (numTrabalhadoras * r.makespan));
+}
+
+int main (int argc, char* argv[]){
+
+    /*Com -v, o segundo trace (do mesmo arquivo de entrada, gravado com outro número de threads ou outro protocolo)
+    serve para validar: a previsão feita a partir do primeiro trace é comparada com o que foi medido no segundo.*/
+    const char* nomePrograma = argv[0];
+    const char* traceValidacao = NULL;
+    if ((argc>=3) && (string(argv[1]) == "-v")){
+        traceValidacao = argv[2];
+        argv += 2;
+        argc -= 2;
+    }
+
+    if ((argc<2)||(argc>6)){
+        fprintf(stderr,"usage %s [-v validationtrace] tracefile [numThreads[,numThreads...] [tamLote [tamFila[n] [limiar[n]]]]]\n", nomePrograma);
+        exit(-1);
+    }
+
+    //Os argumentos são validados antes de ler o trace
+    vector<unsigned int> listaThreads;
+    if (argc>=3){
+        stringstream lista(argv[2]);
+        string item;
+        while (getline(lista, item, ',')){
+            listaThreads.push_back(lerInteiroPositivo(item, "numThreads"));
+        }
+    }
+
+    unsigned int tamLote = 4;
+    if (argc>=4){
+        tamLote = lerInteiroPositivo(argv[3], "tamLote");
+    }
+
+    parametro_protocolo_t tamFila, limiar;
+    if (argc>=5){
+        tamFila = lerParametroProtocolo(argv[4], "tamFila");
+    }
+    if (argc>=6){
+        limiar = lerParametroProtocolo(argv[5], "limiar");
+    }
+
+    lerTrace(argv[1], cabecalho, registros);
+    analisarTrace();
+
+    //Por padrão simula o mesmo número de trabalhadoras e o mesmo protocolo da execução gravada
+    if (listaThreads.empty()){
+        listaThreads.push_back(cabecalho.numThreadsTrabalhadoras);
+    }
+    if (argc<5){
+        tamFila = parametroGravado(cabecalho.tamMaxFilaFractais);
+    }
+    if (argc<6){
+        limiar = parametroGravado(cabecalho.limiarReabastecimento);
+    }
+
+    for (size_t i = 0; i < listaThreads.size(); ++i) {
+        if (resolverParametro(limiar, listaThreads[i]) > resolverParametro(tamFila, listaThreads[i])){
+            fprintf(stderr,"limiar (%s) maior que tamFila (%s) com %u threads\n",
+                descreverParametro(limiar).c_str(), descreverParametro(tamFila).c_str(), listaThreads[i]);
+            exit(-1);
+        }
+    }
+
+    if (traceValidacao != NULL){
+        cabecalho_trace_t cabecalhoValidacao;
+        vector<registro_trace_t> registrosValidacao;
+        size_t numTilesValidacao;
+
+        lerTrace(traceValidacao, cabecalhoValidacao, registrosValidacao);
+        resultado_simulacao_t medido = medirExecucao(cabecalhoValidacao, registrosValidacao, &numTilesValidacao);
+        if (numTilesValidacao != custos.size()){
+            fprintf(stderr,"%s: %zu tiles, mas o trace simulado tem %zu; use o mesmo arquivo de entrada\n",
+                traceValidacao, numTilesValidacao, custos.size());
+            exit(-1);
+        }
+
+        resultado_simulacao_t previsto = simularProtocolo(custos, cabecalhoValidacao.numThreadsTrabalhadoras, 1,
+            cabecalhoValidacao.tamMaxFilaFractais, cabecalhoValidacao.limiarReabastecimento);
+        printf("Validacao com %s: fifo com %u trabalhadoras, fila %u e limiar %u\n", traceValidacao,
+            cabecalhoValidacao.numThreadsTrabalhadoras, cabecalhoValidacao.tamMaxFilaFractais, cabecalhoValidacao.limiarReabastecimento);
+        printf("  makespan:   previsto = %.6f s; medido = %.6f s (erro de %.2f%%)\n",
+            previsto.makespan, medido.makespan, 100.0 * (previsto.makespan - medido.makespan) / medido.makespan);
+        printf("  ociosidade: previsto = %.6f s; medido = %.6f s\n", previsto.ociosidade, medido.ociosidade);
+    }
+    else{
+        //Repetir a própria execução gravada só mostra que o modelo é consistente com ela; não valida outras configurações
+        resultado_simulacao_t reproducao = simularProtocolo(custos, cabecalho.numThreadsTrabalhadoras, 1,
+            cabecalho.tamMaxFilaFractais, cabecalho.limiarReabastecimento);
+        printf("Reproducao da execucao gravada (nao e validacao; use -v): fifo preve makespan = %.6f s contra %.6f s medidos\n",
+            reproducao.makespan, execucaoGravada.makespan);
+    }
+
+    vector<double> decrescente = custos;
+    sort(decrescente.begin(), decrescente.end(), greater<double>());
+
+    char nomeLote[16];
+    snprintf(nomeLote, sizeof(nomeLote), "lote%u", tamLote);
+
+    printf("\nProtocolo simulado: fila de ate %s fractais; reabastece com menos de %s\n",
+        descreverParametro(tamFila).c_str(), descreverParametro(limiar).c_str());
+    printf("%-8s %8s %14s %14s %10s\n", "politica", "threads", "makespan(s)", "ociosidade(s)", "ociosa");
+    for (size_t i = 0; i < listaThreads.size(); ++i) {
+        unsigned int n = listaThreads[i];
+        unsigned int fila = resolverParametro(tamFila, n), lim = resolverParametro(limiar, n);
+        imprimirResultado("fifo", n, simularProtocolo(custos, n, 1, fila, lim));
+        imprimirResultado("lpt", n, simularProtocolo(decrescente, n, 1, fila, lim));
+        imprimirResultado("roubo", n, simularRouboDeTrabalho(custos, n));
+        imprimirResultado(nomeLote, n, simularProtocolo(custos, n, tamLote, fila, lim));
+    }
+
+	return 0;
+
+}
@@ -0,0 +1,39 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/*Formato binário do trace do escalonador, gravado pelo prog e lido pelo simulador.
+O arquivo é um cabecalho_trace_t seguido de numRegistros registro_trace_t. Todos os
+instantes são de relógio de parede, em segundos desde o início da execução do prog. O custo
+de cada tile é tempo de CPU da trabalhadora, que não inclui o tempo em que ela ficou fora
+do processador quando há mais threads que núcleos.*/
+
+#define TRACE_MAGICO 0x4352544d //"MTRC"
+#define TRACE_VERSAO 3
+
+#define TRACE_TILE 0            //Um tile calculado por uma trabalhadora
+#define TRACE_ESPERA 1          //Uma trabalhadora parada esperando a fila ser preenchida
+#define TRACE_REABASTECIMENTO 2 //Uma chamada de preencherFilaFractais pela thread mestre
+
+typedef struct {
+    uint32_t magico;
+    uint32_t versao;
+    uint32_t numThreadsTrabalhadoras;
+    uint32_t tamMaxFilaFractais;
+    uint32_t limiarReabastecimento; //Reabastece quando a fila tem menos fractais que isso
+    uint32_t reservado;
+    uint64_t numRegistros;
+} cabecalho_trace_t;
+
+typedef struct {
+    uint16_t tipo;
+    uint16_t thread;    //0 = thread mestre, 1..n = trabalhadoras
+    uint32_t indice;    //TILE: posição do tile no arquivo de entrada; REABASTECIMENTO: tiles lidos do arquivo (sem os EOW)
+    double enfileirado; //TILE: instante em que o tile entrou na fila; demais: não usado
+    double inicio;      //TILE: instante em que foi retirado da fila; demais: início do intervalo
+    double fim;         //TILE: fim do cálculo; demais: fim do intervalo
+    double custoCpu;    //TILE: tempo de CPU gasto em fractal() (CLOCK_THREAD_CPUTIME_ID); demais: não usado
+} registro_trace_t;
+
+#endif